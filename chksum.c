@@ -0,0 +1,111 @@
+#include "lwip/opt.h"
+#include "lwip/arch.h"
+#include <string.h>
+#include "pico/platform.h"
+
+// Internet checksum for lwIP (LWIP_CHKSUM / LWIP_CHKSUM_COPY, see lwipopts.h)
+// tuned for the Cortex-M0+, which has no unaligned loads. Unaligned heads and
+// tails are summed here, the word aligned middle by the unrolled add-with-carry
+// loops in chksum.S. Everything runs from SRAM.
+//
+// Sums are kept as the 32 bit total of the little-endian halfwords in memory,
+// which is what lwIP expects back once folded to 16 bits. Data starting on an
+// odd address has its first byte in the high half of a halfword, so the
+// folded result gets its bytes swapped.
+
+uint32_t chksum_blocks(const uint32_t *src, uint32_t blocks, uint32_t sum);
+uint32_t chksum_copy_blocks(uint32_t *dst, const uint32_t *src, uint32_t blocks, uint32_t sum);
+
+static inline uint32_t chksum_add(uint32_t sum, uint32_t value)
+{
+    sum += value;
+    return sum + (sum < value);
+}
+
+static inline u16_t chksum_fold(uint32_t sum, bool odd)
+{
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    if (odd)
+    {
+        sum = ((sum & 0xFF) << 8) | (sum >> 8);
+    }
+    return (u16_t)sum;
+}
+
+static uint32_t __not_in_flash_func(chksum_accumulate)(const uint8_t *p, int len, uint32_t sum)
+{
+    if (((uintptr_t)p & 1) && len > 0)
+    {
+        sum = chksum_add(sum, p[0] << 8);
+        p++;
+        len--;
+    }
+    if (((uintptr_t)p & 2) && len >= 2)
+    {
+        sum = chksum_add(sum, *(const uint16_t *)p);
+        p += 2;
+        len -= 2;
+    }
+    if (len >= 32)
+    {
+        sum = chksum_blocks((const uint32_t *)p, len / 32, sum);
+        p += len & ~31;
+        len &= 31;
+    }
+    while (len >= 4)
+    {
+        sum = chksum_add(sum, *(const uint32_t *)p);
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2)
+    {
+        sum = chksum_add(sum, *(const uint16_t *)p);
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0)
+    {
+        sum = chksum_add(sum, p[0]);
+    }
+    return sum;
+}
+
+u16_t __not_in_flash_func(pico_chksum)(const void *dataptr, int len)
+{
+    return chksum_fold(chksum_accumulate(dataptr, len, 0), (uintptr_t)dataptr & 1);
+}
+
+u16_t __not_in_flash_func(pico_chksum_copy)(void *dst, const void *src, u16_t len)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    uint32_t sum = 0;
+
+    // with both sides equally aligned, copy and sum the word aligned middle
+    // in a single pass
+    if ((((uintptr_t)d ^ (uintptr_t)s) & 3) == 0)
+    {
+        u16_t head = -(uintptr_t)d & 3;
+        if (head > len)
+        {
+            head = len;
+        }
+        memcpy(d, s, head);
+        sum = chksum_accumulate(d, head, sum);
+        d += head;
+        s += head;
+        len -= head;
+        if (len >= 16)
+        {
+            sum = chksum_copy_blocks((uint32_t *)d, (const uint32_t *)s, len / 16, sum);
+            d += len & ~15;
+            s += len & ~15;
+            len &= 15;
+        }
+    }
+    memcpy(d, s, len);
+    sum = chksum_accumulate(d, len, sum);
+    return chksum_fold(sum, (uintptr_t)dst & 1);
+}
@@ -0,0 +1,108 @@
+#include "lwip/opt.h"
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+
+// Cycles per byte of pico_chksum and pico_chksum_copy against a plain C
+// byte-pair reference, counted with SysTick at the processor clock.
+// Built with the CHKSUM_BENCH CMake option and run once at startup.
+
+#define BENCH_RUNS 32
+
+static uint8_t bench_src[1536] __attribute__((aligned(4)));
+static uint8_t bench_dst[1536] __attribute__((aligned(4)));
+
+static const int bench_lens[] = {20, 64, 576, 1460};
+
+static u16_t __not_in_flash_func(reference_chksum)(const void *dataptr, int len)
+{
+    const uint8_t *p = dataptr;
+    uint32_t sum = 0;
+
+    for (; len > 1; len -= 2, p += 2)
+    {
+        sum += (p[0] << 8) | p[1];
+    }
+    if (len)
+    {
+        sum += p[0] << 8;
+    }
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    return (u16_t)((sum >> 8) | (sum << 8));
+}
+
+static u16_t __not_in_flash_func(reference_chksum_copy)(void *dst, const void *src, u16_t len)
+{
+    memcpy(dst, src, len);
+    return reference_chksum(dst, len);
+}
+
+// SysTick counts down from 0xFFFFFF, one call stays well inside that
+static inline uint32_t cycles_since(uint32_t start)
+{
+    return (start - systick_hw->cvr) & 0xFFFFFF;
+}
+
+static uint32_t bench_sum(u16_t (*fn)(const void *, int), int ofs, int len, u16_t *result)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        uint32_t start = systick_hw->cvr;
+        *result = fn(bench_src + ofs, len);
+        total += cycles_since(start);
+    }
+    return total / BENCH_RUNS;
+}
+
+static uint32_t bench_copy(u16_t (*fn)(void *, const void *, u16_t), int ofs, int len, u16_t *result)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        uint32_t start = systick_hw->cvr;
+        *result = fn(bench_dst + ofs, bench_src + ofs, len);
+        total += cycles_since(start);
+    }
+    return total / BENCH_RUNS;
+}
+
+static void print_row(const char *name, int ofs, int len, uint32_t cycles, uint32_t ref_cycles, bool match)
+{
+    uint32_t cpb = cycles * 100 / len;
+    uint32_t ref_cpb = ref_cycles * 100 / len;
+    printf("chksum: %-5s +%d %4d bytes: %5lu cycles %lu.%02lu/byte, reference %lu.%02lu/byte%s\n",
+           name, ofs, len, cycles, cpb / 100, cpb % 100, ref_cpb / 100, ref_cpb % 100,
+           match ? "" : " MISMATCH");
+}
+
+void chksum_bench(void)
+{
+    u16_t sum, ref;
+
+    for (uint i = 0; i < sizeof(bench_src); i++)
+    {
+        bench_src[i] = i * 7 + (i >> 8);
+    }
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->cvr = 0;
+    // enabled, processor clock
+    systick_hw->csr = 0x5;
+
+    for (uint i = 0; i < count_of(bench_lens); i++)
+    {
+        for (int ofs = 0; ofs < 2; ofs++)
+        {
+            int len = bench_lens[i];
+            uint32_t cycles = bench_sum(pico_chksum, ofs, len, &sum);
+            uint32_t ref_cycles = bench_sum(reference_chksum, ofs, len, &ref);
+            print_row("sum", ofs, len, cycles, ref_cycles, sum == ref);
+
+            cycles = bench_copy(pico_chksum_copy, ofs, len, &sum);
+            ref_cycles = bench_copy(reference_chksum_copy, ofs, len, &ref);
+            print_row("copy", ofs, len, cycles, ref_cycles, sum == ref);
+        }
+    }
+}
@@ -25,6 +25,9 @@
 #include "hardware/spi.h"
 #include "hardware/gpio.h"
 #include "hardware/timer.h"
+#if ENC28J60_RX_SNIFF
+#include "hardware/dma.h"
+#endif
 #include <stdio.h>
 // #include "Arduino.h"  //all things wiring / arduino
 //#include "timeout.h"
@@ -40,6 +43,15 @@
 
 static uint8_t Enc28j60Bank;
 static uint16_t NextPacketPtr;
+static uint16_t TxStartPtr;
+// ones' complement sum of the last frame read, see enc28j60RxChecksum()
+static uint16_t RxSum;
+static uint8_t RxSumValid;
+#if ENC28J60_RX_SNIFF
+static int RxDmaChan = -1;
+static int TxDmaChan = -1;
+static uint8_t RxSniff;
+#endif
 
 #ifdef PICO_DEFAULT_SPI_CSN_PIN
 static inline void cs_select()
@@ -57,12 +69,12 @@ static inline void cs_deselect()
 }
 #endif
 
-void spi_write_single(uint8_t data)
+void ENC28J60_HOT(spi_write_single)(uint8_t data)
 {
 	spi_write_blocking(spi_default, &data, 1);
 }
 
-uint8_t enc28j60ReadOp(uint8_t op, uint8_t address)
+uint8_t ENC28J60_HOT(enc28j60ReadOp)(uint8_t op, uint8_t address)
 {
 	cs_select();
 
@@ -83,7 +95,7 @@ uint8_t enc28j60ReadOp(uint8_t op, uint8_t address)
 	return (dst[0]);
 }
 
-void enc28j60WriteOp(uint8_t op, uint8_t address, uint8_t data)
+void ENC28J60_HOT(enc28j60WriteOp)(uint8_t op, uint8_t address, uint8_t data)
 {
 	cs_select();
 
@@ -96,7 +108,7 @@ void enc28j60WriteOp(uint8_t op, uint8_t address, uint8_t data)
 	cs_deselect();
 }
 
-void enc28j60ReadBuffer(uint16_t len, uint8_t *data)
+void ENC28J60_HOT(enc28j60ReadBuffer)(uint16_t len, uint8_t *data)
 {
 	cs_select();
 
@@ -108,15 +120,13 @@ void enc28j60ReadBuffer(uint16_t len, uint8_t *data)
 	cs_deselect();
 }
 
-void enc28j60WriteBuffer(uint16_t len, uint8_t *data)
+void ENC28J60_HOT(enc28j60WriteBuffer)(uint16_t len, uint8_t *data)
 {
 	cs_select();
 
 	// issue write command
 	spi_write_single(ENC28J60_WRITE_BUF_MEM);
 
-	printf("writing %d bytes to SPI\n", len);
-
 	// write byte by byte
 	// for (int i = 0; i < len; i+=4) {
 	// 	printf("byte %d = %02x %02x %02x %02x\n", i, data[i], data[i+1], data[i+2], data[i+3]);
@@ -134,7 +144,7 @@ void enc28j60WriteBuffer(uint16_t len, uint8_t *data)
 	cs_deselect();
 }
 
-void enc28j60SetBank(uint8_t address)
+void ENC28J60_HOT(enc28j60SetBank)(uint8_t address)
 {
 	// set the bank (if needed)
 	if ((address & BANK_MASK) != Enc28j60Bank)
@@ -146,7 +156,7 @@ void enc28j60SetBank(uint8_t address)
 	}
 }
 
-uint8_t enc28j60Read(uint8_t address)
+uint8_t ENC28J60_HOT(enc28j60Read)(uint8_t address)
 {
 	// set the bank
 	enc28j60SetBank(address);
@@ -154,7 +164,7 @@ uint8_t enc28j60Read(uint8_t address)
 	return enc28j60ReadOp(ENC28J60_READ_CTRL_REG, address);
 }
 
-void enc28j60Write(uint8_t address, uint8_t data)
+void ENC28J60_HOT(enc28j60Write)(uint8_t address, uint8_t data)
 {
 	// set the bank
 	enc28j60SetBank(address);
@@ -182,6 +192,89 @@ void enc28j60clkout(uint8_t clk)
 	enc28j60Write(ECOCON, clk & 0x7);
 }
 
+#if ENC28J60_RX_SNIFF
+// Claims the DMA channels for receive and checks, with a small memory to
+// memory copy set up like enc28j60ReadSniffed(), that the sniffer's sum mode
+// adds 16 bit transfers up as halfwords after the byte swap.
+// Receive falls back to plain SPI reads if it does not.
+static void enc28j60SniffInit(void)
+{
+	static const uint16_t src[2] = {0x0180, 0x0280};
+	uint16_t dst[2];
+	dma_channel_config c;
+
+	if (RxDmaChan < 0)
+	{
+		RxDmaChan = dma_claim_unused_channel(true);
+		TxDmaChan = dma_claim_unused_channel(true);
+	}
+	c = dma_channel_get_default_config(RxDmaChan);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_bswap(&c, true);
+	channel_config_set_sniff_enable(&c, true);
+	dma_sniffer_enable(RxDmaChan, DMA_SNIFF_CTRL_CALC_VALUE_SUM, true);
+	dma_hw->sniff_data = 0;
+	dma_channel_configure(RxDmaChan, &c, dst, src, 2, true);
+	dma_channel_wait_for_finish_blocking(RxDmaChan);
+	RxSniff = (dma_hw->sniff_data == 0x10003 && dst[0] == 0x8001 && dst[1] == 0x8002);
+	dma_sniffer_disable();
+	if (!RxSniff)
+	{
+		printf("enc28j60: DMA sniffer sum check failed, lwIP checks receive checksums\n");
+	}
+}
+
+// Reads len bytes of buffer memory into data (halfword aligned) by DMA and
+// returns the 32 bit sum of the little-endian halfwords, added up by the DMA
+// sniffer on the way. The SPI runs 16 bit frames for this, which carry the
+// first byte in the high half; the channel's byte swap puts it back in memory
+// order, and the sniffer sits behind the swap.
+static uint32_t ENC28J60_HOT(enc28j60ReadSniffed)(uint16_t len, uint8_t *data)
+{
+	static const uint16_t dummy = 0;
+	uint16_t halfwords = len / 2;
+	uint32_t sum = 0;
+	dma_channel_config c;
+
+	if (halfwords)
+	{
+		spi_set_format(spi_default, 16, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+
+		c = dma_channel_get_default_config(TxDmaChan);
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+		channel_config_set_read_increment(&c, false);
+		channel_config_set_write_increment(&c, false);
+		channel_config_set_dreq(&c, spi_get_dreq(spi_default, true));
+		dma_channel_configure(TxDmaChan, &c, &spi_get_hw(spi_default)->dr, &dummy, halfwords, false);
+
+		c = dma_channel_get_default_config(RxDmaChan);
+		channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+		channel_config_set_read_increment(&c, false);
+		channel_config_set_write_increment(&c, true);
+		channel_config_set_dreq(&c, spi_get_dreq(spi_default, false));
+		channel_config_set_bswap(&c, true);
+		channel_config_set_sniff_enable(&c, true);
+		dma_channel_configure(RxDmaChan, &c, data, &spi_get_hw(spi_default)->dr, halfwords, false);
+
+		dma_sniffer_enable(RxDmaChan, DMA_SNIFF_CTRL_CALC_VALUE_SUM, true);
+		dma_hw->sniff_data = 0;
+		dma_start_channel_mask((1u << TxDmaChan) | (1u << RxDmaChan));
+		dma_channel_wait_for_finish_blocking(RxDmaChan);
+		sum = dma_hw->sniff_data;
+		dma_sniffer_disable();
+
+		spi_set_format(spi_default, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+	}
+	if (len & 1)
+	{
+		// the odd byte is the low half of the last halfword
+		spi_read_blocking(spi_default, 0, &data[len - 1], 1);
+		sum += data[len - 1];
+	}
+	return (sum);
+}
+#endif
+
 void enc28j60Init(uint8_t *macaddr)
 {
 	// initialize I/O
@@ -224,9 +317,16 @@ void enc28j60Init(uint8_t *macaddr)
 	// TX start
 	enc28j60Write(ETXSTL, TXSTART_INIT & 0xFF);
 	enc28j60Write(ETXSTH, TXSTART_INIT >> 8);
+	TxStartPtr = TXSTART_INIT;
 	// TX end
 	enc28j60Write(ETXNDL, TXSTOP_INIT & 0xFF);
 	enc28j60Write(ETXNDH, TXSTOP_INIT >> 8);
+#if ENC28J60_STREAM_SIZE
+	// per-packet control byte of the stream frame, written once
+	enc28j60Write(EWRPTL, STREAM_START_INIT & 0xFF);
+	enc28j60Write(EWRPTH, STREAM_START_INIT >> 8);
+	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
+#endif
 	// do bank 1 stuff, packet filter:
 	// For broadcast packets we allow only ARP packtets
 	// All other packets should be unicast only for our mac (MAADR)
@@ -277,6 +377,9 @@ void enc28j60Init(uint8_t *macaddr)
 	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE | EIE_PKTIE);
 	// enable packet reception
 	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+#if ENC28J60_RX_SNIFF
+	enc28j60SniffInit();
+#endif
 }
 
 // read the revision of the chip:
@@ -285,31 +388,422 @@ uint8_t enc28j60getrev(void)
 	return (enc28j60Read(EREVID));
 }
 
-void enc28j60PacketSend(uint16_t len, uint8_t *packet)
+// Free space left in the receive ring (see datasheet page 46, equation 7-1)
+uint16_t ENC28J60_HOT(enc28j60RxFreeSpace)(void)
+{
+	uint16_t wrpt;
+	uint16_t rdpt;
+	// ERXWRPT is only stable to read right after EPKTCNT, see datasheet 7.2.4
+	enc28j60Read(EPKTCNT);
+	wrpt = enc28j60Read(ERXWRPTL);
+	wrpt |= enc28j60Read(ERXWRPTH) << 8;
+	rdpt = enc28j60Read(ERXRDPTL);
+	rdpt |= enc28j60Read(ERXRDPTH) << 8;
+	if (wrpt > rdpt)
+	{
+		return (RXSTOP_INIT - RXSTART_INIT) - (wrpt - rdpt);
+	}
+	else if (wrpt == rdpt)
+	{
+		return (RXSTOP_INIT - RXSTART_INIT);
+	}
+	return (rdpt - wrpt - 1);
+}
+
+// Returns 1 if the chip dropped a frame for lack of receive buffer space
+// since the last call (EIR.RXERIF), and acknowledges the flag.
+uint8_t enc28j60RxOverflow(void)
+{
+	if (enc28j60Read(EIR) & EIR_RXERIF)
+	{
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_RXERIF);
+		return (1);
+	}
+	return (0);
+}
+
+// Asserts or releases flow control towards the link partner.
+// Full duplex (EFLOCON.FULDPXS set): FCEN1:FCEN0 = 10 sends PAUSE frames
+// carrying the given pause time (in 512 bit-time quanta) and repeats them
+// while flow control is on; 11 sends one PAUSE frame with a zero timer to
+// release the partner and then turns flow control off.
+// Half duplex: only FCEN0 counts, 1 enables backpressure (jamming) and 0
+// disables it; pause is unused.
+void enc28j60FlowControl(uint8_t on, uint16_t pause)
+{
+	if (enc28j60Read(EFLOCON) & EFLOCON_FULDPXS)
+	{
+		if (on)
+		{
+			enc28j60Write(EPAUSL, pause & 0xFF);
+			enc28j60Write(EPAUSH, pause >> 8);
+			enc28j60Write(EFLOCON, EFLOCON_FCEN1);
+		}
+		else
+		{
+			enc28j60Write(EFLOCON, EFLOCON_FCEN1 | EFLOCON_FCEN0);
+		}
+	}
+	else
+	{
+		enc28j60Write(EFLOCON, on ? EFLOCON_FCEN0 : 0);
+	}
+}
+
+// After a transmit error the TX logic can stall with TXRTS still set, see
+// Rev. B4 Silicon Errata point 12. If TXERIF shows one, resets the TX logic
+// and clears the flag so it is idle again. Returns 1 if it had to.
+static uint8_t ENC28J60_HOT(enc28j60TxRecover)(void)
+{
+	if (!(enc28j60Read(EIR) & EIR_TXERIF))
+	{
+		return (0);
+	}
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXERIF);
+	return (1);
+}
+
+// Returns 1 while the previous frame is still being sent
+static uint8_t ENC28J60_HOT(enc28j60TxBusy)(void)
+{
+	if (!(enc28j60Read(ECON1) & ECON1_TXRTS))
+	{
+		return (0);
+	}
+	if (enc28j60TxRecover())
+	{
+		return (0);
+	}
+	return (1);
+}
+
+// Waits until the previous frame has left, its transmit memory and
+// ETXST/ETXND must not be touched before that
+static void ENC28J60_HOT(enc28j60TxWait)(void)
+{
+	while (enc28j60TxBusy())
+	{
+	}
+}
+
+// Transmits the frame whose control byte is at start
+static void ENC28J60_HOT(enc28j60TxStart)(uint16_t start, uint16_t len)
+{
+	// ETXST only moves when switching between the TX buffer and the stream frame
+	if (start != TxStartPtr)
+	{
+		enc28j60Write(ETXSTL, start & 0xFF);
+		enc28j60Write(ETXSTH, start >> 8);
+		TxStartPtr = start;
+	}
+	// Set the TXND pointer to correspond to the packet size given
+	enc28j60Write(ETXNDL, (start + len) & 0xFF);
+	enc28j60Write(ETXNDH, (start + len) >> 8);
+
+	// a transmit error left behind by an earlier frame would cancel this one,
+	// see Rev. B4 Silicon Errata point 12
+	// http://ww1.microchip.com/downloads/en/DeviceDoc/80349c.pdf
+	enc28j60TxRecover();
+	// send the contents of the transmit buffer onto the network
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+
+	// status vector: TXND + 1;
+	// uint16_t status = ((enc28j60Read(ETXNDH) << 8) | enc28j60Read(ETXNDL)) + 1;
+}
+
+// Transmit store bookkeeping, oldest frame first. A stored frame is its
+// per-packet control byte followed by the frame, starting on an even address.
+static struct
+{
+	uint16_t addr;
+	uint16_t len;
+} TxStore[ENC28J60_TXSTORE_SLOTS];
+static uint8_t TxStoreHead;
+static uint8_t TxStoreCount;
+static struct enc28j60TxStoreStats TxStoreStats;
+
+// store space taken by a frame of len bytes
+static uint16_t ENC28J60_HOT(enc28j60TxStoreSpan)(uint16_t len)
+{
+	return ((len + 2) & ~1);
+}
+
+// Finds room for a frame of len bytes behind the newest stored frame.
+// Returns 0 if there is none.
+static uint8_t ENC28J60_HOT(enc28j60TxStoreAlloc)(uint16_t len, uint16_t *addr)
+{
+	uint16_t span = enc28j60TxStoreSpan(len);
+	uint16_t head;
+	uint16_t tail;
+	uint8_t last;
+
+	if (TxStoreCount == ENC28J60_TXSTORE_SLOTS)
+	{
+		return (0);
+	}
+	if (TxStoreCount == 0)
+	{
+		*addr = TXSTORE_START_INIT;
+		return (TXSTORE_START_INIT + span - 1 <= TXSTORE_STOP_INIT);
+	}
+	head = TxStore[TxStoreHead].addr;
+	last = (TxStoreHead + TxStoreCount - 1) % ENC28J60_TXSTORE_SLOTS;
+	tail = TxStore[last].addr + enc28j60TxStoreSpan(TxStore[last].len);
+	if (tail > head)
+	{
+		// free space is behind the tail and in front of the head
+		if (tail + span - 1 <= TXSTORE_STOP_INIT)
+		{
+			*addr = tail;
+			return (1);
+		}
+		*addr = TXSTORE_START_INIT;
+		return (TXSTORE_START_INIT + span <= head);
+	}
+	// wrapped, free space is between the tail and the head
+	*addr = tail;
+	return (tail + span <= head);
+}
+
+// Parks a frame in the transmit store, returns 0 if it is full
+static uint8_t ENC28J60_HOT(enc28j60TxStorePut)(uint16_t len, uint8_t *packet)
+{
+	uint16_t addr;
+	uint8_t slot;
+
+	if (!enc28j60TxStoreAlloc(len, &addr))
+	{
+		return (0);
+	}
+	enc28j60Write(EWRPTL, addr & 0xFF);
+	enc28j60Write(EWRPTH, addr >> 8);
+	// write per-packet control byte (0x00 means use macon3 settings)
+	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
+	enc28j60WriteBuffer(len, packet);
+
+	slot = (TxStoreHead + TxStoreCount) % ENC28J60_TXSTORE_SLOTS;
+	TxStore[slot].addr = addr;
+	TxStore[slot].len = len;
+	TxStoreCount++;
+	TxStoreStats.hits++;
+	TxStoreStats.used += enc28j60TxStoreSpan(len);
+	if (TxStoreStats.used > TxStoreStats.peak)
+	{
+		TxStoreStats.peak = TxStoreStats.used;
+	}
+	return (1);
+}
+
+// Sends the oldest stored frame if the TX buffer is free: the DMA copies it,
+// control byte included, to TXSTART_INIT. The TX buffer has room behind the
+// frame for the transmit status vector, which would otherwise overwrite
+// the next stored frame.
+// Returns: Number of frames still waiting in the store.
+uint8_t ENC28J60_HOT(enc28j60TxPoll)(void)
+{
+	uint16_t addr;
+	uint16_t len;
+
+	if (TxStoreCount == 0 || enc28j60TxBusy())
+	{
+		return (TxStoreCount);
+	}
+	addr = TxStore[TxStoreHead].addr;
+	len = TxStore[TxStoreHead].len;
+
+	enc28j60Write(EDMASTL, addr & 0xFF);
+	enc28j60Write(EDMASTH, addr >> 8);
+	enc28j60Write(EDMANDL, (addr + len) & 0xFF);
+	enc28j60Write(EDMANDH, (addr + len) >> 8);
+	enc28j60Write(EDMADSTL, TXSTART_INIT & 0xFF);
+	enc28j60Write(EDMADSTH, TXSTART_INIT >> 8);
+	// copy mode, not checksum
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_CSUMEN);
+	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_DMAST);
+	while (enc28j60Read(ECON1) & ECON1_DMAST)
+	{
+	}
+	enc28j60TxStart(TXSTART_INIT, len);
+
+	TxStoreHead = (TxStoreHead + 1) % ENC28J60_TXSTORE_SLOTS;
+	TxStoreCount--;
+	TxStoreStats.replays++;
+	TxStoreStats.used -= enc28j60TxStoreSpan(len);
+	return (TxStoreCount);
+}
+
+void enc28j60GetTxStoreStats(struct enc28j60TxStoreStats *stats)
+{
+	*stats = TxStoreStats;
+}
+
+void ENC28J60_HOT(enc28j60PacketSend)(uint16_t len, uint8_t *packet)
 {
+#if ENC28J60_TXSTORE_SIZE
+	// stay behind frames already in the store, and park the frame there
+	// rather than wait while the TX buffer is busy
+	if (TxStoreCount || enc28j60TxBusy())
+	{
+		if (enc28j60TxStorePut(len, packet))
+		{
+			return;
+		}
+		// store full, wait for it to drain
+		TxStoreStats.misses++;
+		while (enc28j60TxPoll())
+		{
+		}
+		enc28j60TxWait();
+	}
+#else
+	enc28j60TxWait();
+#endif
 	// Set the write pointer to start of transmit buffer area
 	enc28j60Write(EWRPTL, TXSTART_INIT & 0xFF);
 	enc28j60Write(EWRPTH, TXSTART_INIT >> 8);
-
-	// Set the TXND pointer to correspond to the packet size given
-	enc28j60Write(ETXNDL, (TXSTART_INIT + len) & 0xFF);
-	enc28j60Write(ETXNDH, (TXSTART_INIT + len) >> 8);
 	// write per-packet control byte (0x00 means use macon3 settings)
 	enc28j60WriteOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
 	// copy the packet into the transmit buffer
 	enc28j60WriteBuffer(len, packet);
 
-	// send the contents of the transmit buffer onto the network
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
-	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-	// http://ww1.microchip.com/downloads/en/DeviceDoc/80349c.pdf
-	if ((enc28j60Read(EIR) & EIR_TXERIF))
+	enc28j60TxStart(TXSTART_INIT, len);
+}
+
+// The stream frame lives in its own slice of buffer memory (STREAM_START_INIT)
+// so a header template written there once survives other transmissions.
+// Writes len bytes at offset into the stream frame, offset 0 being the first
+// byte of the Ethernet header.
+void ENC28J60_HOT(enc28j60StreamWrite)(uint16_t offset, uint16_t len, uint8_t *data)
+{
+	uint16_t addr = STREAM_START_INIT + 1 + offset;
+
+	// only the stream frame itself being sent holds up writes to it, frames
+	// going out of the TX buffer use other memory
+	if (TxStartPtr == STREAM_START_INIT)
 	{
-		enc28j60WriteOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+		enc28j60TxWait();
 	}
+	enc28j60Write(EWRPTL, addr & 0xFF);
+	enc28j60Write(EWRPTH, addr >> 8);
+	enc28j60WriteBuffer(len, data);
+}
 
-	// status vector: TXND + 1;
-	// uint16_t status = ((enc28j60Read(ETXNDH) << 8) | enc28j60Read(ETXNDL)) + 1;
+// Transmits the first len bytes of the stream frame, once the frame
+// already on the wire has left
+void ENC28J60_HOT(enc28j60StreamSend)(uint16_t len)
+{
+	enc28j60TxWait();
+	enc28j60TxStart(STREAM_START_INIT, len);
+}
+
+// Distance from one receive ring address to another, wrapping at RXSTOP_INIT
+static uint16_t ENC28J60_HOT(enc28j60RxDistance)(uint16_t from, uint16_t to)
+{
+	if (to >= from)
+	{
+		return (to - from);
+	}
+	return ((RXSTOP_INIT - RXSTART_INIT + 1) - (from - to));
+}
+
+// Reads the frame at NextPacketPtr, ERDPT must already point at it.
+// The receive status vector, the payload and the trailing CRC/padding are
+// clocked out in one READ_BUF_MEM burst; the buffer memory auto-increments
+// and wraps at ERXND, so ERDPT is left at the start of the next frame.
+// rx_buffer is asked for a destination once the length is known.
+// Returns the length stored in *packet, *packet is NULL if the frame was dropped.
+static uint16_t ENC28J60_HOT(enc28j60ReadFrame)(uint16_t maxlen, enc28j60RxBufferFn rx_buffer, void *arg, uint8_t **packet)
+{
+	uint8_t header[6];
+	uint8_t discard[8];
+	uint16_t framePtr = NextPacketPtr;
+	uint16_t rxstat;
+	uint16_t len;
+	uint16_t skip;
+
+	cs_select();
+	spi_write_single(ENC28J60_READ_BUF_MEM);
+	// next packet pointer, packet length and receive status
+	// (see datasheet page 43)
+	spi_read_blocking(spi_default, 0, header, sizeof(header));
+	NextPacketPtr = header[0] | (header[1] << 8);
+	len = header[2] | (header[3] << 8);
+	rxstat = header[4] | (header[5] << 8);
+	len -= 4; //remove the CRC count
+	// limit retrieve length
+	if (len > maxlen)
+	{
+		len = maxlen;
+	}
+	// check CRC and symbol errors (see datasheet page 44, table 7-3):
+	// The ERXFCON.CRCEN is set by default. Normally we should not
+	// need to check this.
+	*packet = NULL;
+	if (rxstat & 0x80)
+	{
+		*packet = rx_buffer(len, arg);
+	}
+	if (*packet != NULL)
+	{
+		// copy the packet from the receive buffer
+		RxSumValid = 0;
+#if ENC28J60_RX_SNIFF
+		if (RxSniff && !((uintptr_t)*packet & 1))
+		{
+			uint32_t sum = enc28j60ReadSniffed(len, *packet);
+			sum = (sum >> 16) + (sum & 0xFFFF);
+			sum = (sum >> 16) + (sum & 0xFFFF);
+			RxSum = sum;
+			RxSumValid = 1;
+		}
+		else
+#endif
+		{
+			spi_read_blocking(spi_default, 0, *packet, len);
+		}
+	}
+	else
+	{
+		len = 0;
+	}
+	// skip the CRC and the padding to the next frame, which start on an
+	// even address. Truncated and dropped frames leave more behind, reposition
+	// ERDPT for those instead of clocking it all out.
+	skip = enc28j60RxDistance(framePtr, NextPacketPtr) - sizeof(header) - len;
+	if (skip <= sizeof(discard))
+	{
+		spi_read_blocking(spi_default, 0, discard, skip);
+		cs_deselect();
+	}
+	else
+	{
+		cs_deselect();
+		enc28j60Write(ERDPTL, (NextPacketPtr));
+		enc28j60Write(ERDPTH, (NextPacketPtr) >> 8);
+	}
+	return (len);
+}
+
+// Hands the receive memory up to NextPacketPtr back to the chip and
+// decrements the packet counter once per frame read out.
+static void ENC28J60_HOT(enc28j60RxRelease)(uint8_t count)
+{
+	// ERXRDPT must be odd, see Rev. B7 Silicon Errata point 14
+	uint16_t rdpt = (NextPacketPtr == RXSTART_INIT) ? RXSTOP_INIT : NextPacketPtr - 1;
+	enc28j60Write(ERXRDPTL, rdpt & 0xFF);
+	enc28j60Write(ERXRDPTH, rdpt >> 8);
+	while (count--)
+	{
+		enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+	}
+}
+
+static uint8_t *ENC28J60_HOT(enc28j60FixedBuffer)(uint16_t len, void *arg)
+{
+	return (arg);
 }
 
 // Gets a packet from the network receive buffer, if one is available.
@@ -317,9 +811,9 @@ void enc28j60PacketSend(uint16_t len, uint8_t *packet)
 //      maxlen  The maximum acceptable length of a retrieved packet.
 //      packet  Pointer where packet data should be stored.
 // Returns: Packet length in bytes if a packet was retrieved, zero otherwise.
-uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t *packet)
+uint16_t ENC28J60_HOT(enc28j60PacketReceive)(uint16_t maxlen, uint8_t *packet)
 {
-	uint16_t rxstat;
+	uint8_t *stored;
 	uint16_t len;
 	// check if a packet has been received and buffered
 	//if( !(enc28j60Read(EIR) & EIR_PKTIF) ){
@@ -332,39 +826,52 @@ uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t *packet)
 	// Set the read pointer to the start of the received packet
 	enc28j60Write(ERDPTL, (NextPacketPtr));
 	enc28j60Write(ERDPTH, (NextPacketPtr) >> 8);
-	// read the next packet pointer
-	NextPacketPtr = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	NextPacketPtr |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0) << 8;
-	// read the packet length (see datasheet page 43)
-	len = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	len |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0) << 8;
-	len -= 4; //remove the CRC count
-	// read the receive status (see datasheet page 43)
-	rxstat = enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0);
-	rxstat |= enc28j60ReadOp(ENC28J60_READ_BUF_MEM, 0) << 8;
-	// limit retrieve length
-	if (len > maxlen - 1)
-	{
-		len = maxlen - 1;
-	}
-	// check CRC and symbol errors (see datasheet page 44, table 7-3):
-	// The ERXFCON.CRCEN is set by default. Normally we should not
-	// need to check this.
-	if ((rxstat & 0x80) == 0)
+	len = enc28j60ReadFrame(maxlen, enc28j60FixedBuffer, packet, &stored);
+	// Move the RX read pointer to the start of the next received packet
+	// This frees the memory we just read out
+	enc28j60RxRelease(1);
+	return (len);
+}
+
+// Ones' complement sum of the frame last handed to rx_done, as the 16 bit sum
+// of its little-endian halfwords (frame offset 0 being a low byte).
+// Only available with ENC28J60_RX_SNIFF, returns 0 if there is none.
+uint8_t ENC28J60_HOT(enc28j60RxChecksum)(uint16_t *sum)
+{
+	*sum = RxSum;
+	return (RxSumValid);
+}
+
+// Drains every frame the chip has buffered (EPKTCNT) in one pass.
+// For each frame rx_buffer(len, arg) returns where to store it, or NULL to
+// drop it, and rx_done(packet, len, arg) is called once it has been read.
+// The receive memory is released in one go once all frames are read.
+//      maxlen  The maximum acceptable length of a retrieved packet.
+// Returns: Number of frames taken off the chip.
+uint8_t ENC28J60_HOT(enc28j60PacketReceiveAll)(uint16_t maxlen, enc28j60RxBufferFn rx_buffer, enc28j60RxDoneFn rx_done, void *arg)
+{
+	uint8_t count;
+	uint8_t *packet;
+	uint16_t len;
+
+	count = enc28j60Read(EPKTCNT);
+	if (count == 0)
 	{
-		// invalid
-		len = 0;
+		return (0);
 	}
-	else
+
+	// the first frame starts at NextPacketPtr, each one after it is reached
+	// by reading through the previous one
+	enc28j60Write(ERDPTL, (NextPacketPtr));
+	enc28j60Write(ERDPTH, (NextPacketPtr) >> 8);
+	for (uint8_t i = 0; i < count; i++)
 	{
-		// copy the packet from the receive buffer
-		enc28j60ReadBuffer(len, packet);
+		len = enc28j60ReadFrame(maxlen, rx_buffer, arg, &packet);
+		if (packet != NULL)
+		{
+			rx_done(packet, len, arg);
+		}
 	}
-	// Move the RX read pointer to the start of the next received packet
-	// This frees the memory we just read out
-	enc28j60Write(ERXRDPTL, (NextPacketPtr));
-	enc28j60Write(ERXRDPTH, (NextPacketPtr) >> 8);
-	// decrement the packet counter indicate we are done with this packet
-	enc28j60WriteOp(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
-	return (len);
+	enc28j60RxRelease(count);
+	return (count);
 }
@@ -203,6 +203,10 @@
 #define MACON3_HFRMLEN 0x04
 #define MACON3_FRMLNEN 0x02
 #define MACON3_FULDPX 0x01
+// ENC28J60 EFLOCON Register Bit Definitions
+#define EFLOCON_FULDPXS 0x04
+#define EFLOCON_FCEN1 0x02
+#define EFLOCON_FCEN0 0x01
 // ENC28J60 MICMD Register Bit Definitions
 #define MICMD_MIISCAN 0x02
 #define MICMD_MIIRD 0x01
@@ -247,16 +251,90 @@
 //
 // start with recbuf at 0/
 #define RXSTART_INIT 0x0
-// receive buffer end
-#define RXSTOP_INIT (0x1FFF - 0x0600 - 1)
+// receive buffer end, odd so ERXRDPT stays odd when it wraps (errata point 14)
+#define RXSTOP_INIT (TXSTORE_START_INIT - 1)
+// transmit store: frames queued while the TX buffer is busy, copied into it
+// by the DMA once it is free. Holds up to ENC28J60_TXSTORE_SLOTS frames.
+// Off by default, the space comes out of the RX ring; define
+// ENC28J60_TXSTORE_SIZE (e.g. 0x0600) to enable it.
+#ifndef ENC28J60_TXSTORE_SIZE
+#define ENC28J60_TXSTORE_SIZE 0
+#endif
+#ifndef ENC28J60_TXSTORE_SLOTS
+#define ENC28J60_TXSTORE_SLOTS 8
+#endif
+#define TXSTORE_START_INIT ((STREAM_START_INIT - ENC28J60_TXSTORE_SIZE) & ~1)
+#define TXSTORE_STOP_INIT (STREAM_START_INIT - 1)
+// stream frame below the TX buffer: control byte, pinned header template,
+// payload and room for the 7 byte transmit status vector.
+// Off by default, the space comes out of the RX ring; define
+// ENC28J60_STREAM_SIZE (e.g. 0x0240) to enable it.
+#ifndef ENC28J60_STREAM_SIZE
+#define ENC28J60_STREAM_SIZE 0
+#endif
+#if ENC28J60_STREAM_SIZE
+#define STREAM_START_INIT ((TXSTART_INIT - ENC28J60_STREAM_SIZE) & ~1)
+#define STREAM_MAX_FRAMELEN (TXSTART_INIT - STREAM_START_INIT - 1 - 7)
+#else
+#define STREAM_START_INIT TXSTART_INIT
+#define STREAM_MAX_FRAMELEN 0
+#endif
 // start TX buffer at 0x1FFF-0x0600, pace for one full ethernet frame (~1500 bytes)
 #define TXSTART_INIT (0x1FFF - 0x0600)
 // stp TX buffer at end of mem
 #define TXSTOP_INIT 0x1FFF
 //
 // max frame length which the conroller will accept:
-#define MAX_FRAMELEN 1500 // (note: maximum ethernet frame length would be 1518)
+#define MAX_FRAMELEN 1518 // maximum Ethernet frame length including the CRC
 //#define MAX_FRAMELEN     600
+// Ethernet header: destination and source MAC address, EtherType
+#define ETH_HDR_LEN 14
+
+// big-endian 16 bit header fields, for building and parsing frames
+static inline void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+}
+
+static inline uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+// transmit store counters, see enc28j60GetTxStoreStats()
+struct enc28j60TxStoreStats
+{
+	uint32_t hits;    // frames parked in the store while the TX buffer was busy
+	uint32_t misses;  // frames that had to wait because the store was full
+	uint32_t replays; // stored frames copied to the TX buffer and sent
+	uint16_t used;    // bytes in use now
+	uint16_t peak;    // most bytes ever in use
+};
+
+// receive callbacks, see enc28j60PacketReceiveAll()
+typedef uint8_t *(*enc28j60RxBufferFn)(uint16_t len, void *arg);
+typedef void (*enc28j60RxDoneFn)(uint8_t *packet, uint16_t len, void *arg);
+
+// Read received frames by DMA and have the DMA sniffer add them up on the
+// way, see enc28j60RxChecksum()
+#ifndef ENC28J60_RX_SNIFF
+#define ENC28J60_RX_SNIFF 1
+#endif
+
+// ENC28J60_RAM_HOT_PATH (set by the CMake option of the same name) runs the
+// SPI, buffer and packet functions from SRAM instead of XIP flash, so a frame
+// never waits on a flash cache miss. Other per-frame code marks itself with
+// ENC28J60_HOT() to follow it.
+#ifndef ENC28J60_RAM_HOT_PATH
+#define ENC28J60_RAM_HOT_PATH 0
+#endif
+#if ENC28J60_RAM_HOT_PATH
+#include "pico/platform.h"
+#define ENC28J60_HOT(func) __not_in_flash_func(func)
+#else
+#define ENC28J60_HOT(func) func
+#endif
 
 // functions
 extern uint8_t enc28j60ReadOp(uint8_t op, uint8_t address);
@@ -270,8 +348,17 @@ extern void enc28j60PhyWrite(uint8_t address, uint16_t data);
 extern void enc28j60clkout(uint8_t clk);
 extern void enc28j60Init(uint8_t *macaddr);
 extern void enc28j60PacketSend(uint16_t len, uint8_t *packet);
+extern uint8_t enc28j60TxPoll(void);
+extern void enc28j60GetTxStoreStats(struct enc28j60TxStoreStats *stats);
+extern void enc28j60StreamWrite(uint16_t offset, uint16_t len, uint8_t *data);
+extern void enc28j60StreamSend(uint16_t len);
 extern uint16_t enc28j60PacketReceive(uint16_t maxlen, uint8_t *packet);
+extern uint8_t enc28j60RxChecksum(uint16_t *sum);
+extern uint8_t enc28j60PacketReceiveAll(uint16_t maxlen, enc28j60RxBufferFn rx_buffer, enc28j60RxDoneFn rx_done, void *arg);
 extern uint8_t enc28j60getrev(void);
+extern uint16_t enc28j60RxFreeSpace(void);
+extern uint8_t enc28j60RxOverflow(void);
+extern void enc28j60FlowControl(uint8_t on, uint16_t pause);
 
 #endif
 //@}
\ No newline at end of file
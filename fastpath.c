@@ -0,0 +1,265 @@
+#include "lwip/udp.h"
+#include "lwip/icmp.h"
+#include "lwip/ip4.h"
+#include "lwip/inet_chksum.h"
+#include "netif/etharp.h"
+#include <string.h>
+#include <stdio.h>
+#include "enc28j60.h"
+#include "fastpath.h"
+
+#define REPLY_HDR_LEN (ETH_HDR_LEN + IP_HLEN + UDP_HLEN)
+
+static struct
+{
+    u16_t port;
+    fastpath_udp_fn recv;
+    void *arg;
+} udp_ports[FASTPATH_UDP_PORTS];
+
+static u8_t udp_count;
+static bool echo_enabled;
+
+// the datagram being handled, set for the duration of a fastpath_udp_fn
+static struct
+{
+    struct netif *netif;
+    const u8_t *frame;
+    u16_t port;
+} current;
+
+static u16_t reply_ip_id;
+// IP header first, word aligned like the frames lwIP builds
+static u8_t reply_buf[ETH_PAD_SIZE + FASTPATH_MAX_FRAME] __attribute__((aligned(4)));
+
+static struct
+{
+    u32_t udp;
+    u32_t echo;
+    u32_t replies;
+    u32_t reply_errors;
+} fastpath_stats;
+
+// Index of the registration for port, or -1
+static int ENC28J60_HOT(udp_port_find)(u16_t port)
+{
+    for (u8_t i = 0; i < udp_count; i++)
+    {
+        if (udp_ports[i].port == port)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+err_t fastpath_udp_register(u16_t port, fastpath_udp_fn recv, void *arg)
+{
+    if (udp_port_find(port) >= 0)
+    {
+        return ERR_USE;
+    }
+    if (udp_count == FASTPATH_UDP_PORTS)
+    {
+        return ERR_MEM;
+    }
+    udp_ports[udp_count].port = port;
+    udp_ports[udp_count].recv = recv;
+    udp_ports[udp_count].arg = arg;
+    udp_count++;
+    return ERR_OK;
+}
+
+void fastpath_udp_unregister(u16_t port)
+{
+    int i = udp_port_find(port);
+    if (i >= 0)
+    {
+        udp_ports[i] = udp_ports[--udp_count];
+    }
+}
+
+void fastpath_echo_enable(bool enable)
+{
+    echo_enabled = enable;
+}
+
+bool ENC28J60_HOT(fastpath_active)(void)
+{
+    return udp_count != 0 || echo_enabled;
+}
+
+bool ENC28J60_HOT(fastpath_match)(const u8_t *frame, u16_t len)
+{
+    if (len < ETH_HDR_LEN + IP_HLEN + UDP_HLEN || get16(&frame[12]) != ETHTYPE_IP)
+    {
+        return false;
+    }
+    const u8_t *iphdr = frame + ETH_HDR_LEN;
+    u16_t hlen = (iphdr[0] & 0x0F) * 4;
+    if (len < ETH_HDR_LEN + hlen + UDP_HLEN)
+    {
+        return false;
+    }
+    const u8_t *data = iphdr + hlen;
+    if (iphdr[9] == IP_PROTO_ICMP)
+    {
+        return echo_enabled && data[0] == ICMP_ECHO;
+    }
+    return iphdr[9] == IP_PROTO_UDP && udp_port_find(get16(&data[2])) >= 0;
+}
+
+err_t ENC28J60_HOT(fastpath_reply)(const void *data, u16_t len)
+{
+    if (current.frame == NULL)
+    {
+        return ERR_VAL;
+    }
+    if (REPLY_HDR_LEN + len > FASTPATH_MAX_FRAME)
+    {
+        fastpath_stats.reply_errors++;
+        return ERR_MEM;
+    }
+
+    const u8_t *rx_iphdr = current.frame + ETH_HDR_LEN;
+    const u8_t *rx_udphdr = rx_iphdr + (rx_iphdr[0] & 0x0F) * 4;
+    u8_t *frame = reply_buf + ETH_PAD_SIZE;
+    u8_t *iphdr = frame + ETH_HDR_LEN;
+    u8_t *udphdr = iphdr + IP_HLEN;
+
+    // Ethernet header, back to where the request came from
+    memcpy(&frame[0], &current.frame[6], 6);
+    memcpy(&frame[6], current.netif->hwaddr, 6);
+    put16(&frame[12], ETHTYPE_IP);
+
+    memset(iphdr, 0, IP_HLEN);
+    iphdr[0] = 0x45;
+    put16(&iphdr[2], IP_HLEN + UDP_HLEN + len);
+    put16(&iphdr[4], reply_ip_id++);
+    iphdr[8] = UDP_TTL;
+    iphdr[9] = IP_PROTO_UDP;
+    memcpy(&iphdr[12], &rx_iphdr[16], 4);
+    memcpy(&iphdr[16], &rx_iphdr[12], 4);
+    u16_t chksum = inet_chksum(iphdr, IP_HLEN);
+    memcpy(&iphdr[10], &chksum, 2);
+
+    put16(&udphdr[0], current.port);
+    memcpy(&udphdr[2], &rx_udphdr[0], 2);
+    put16(&udphdr[4], UDP_HLEN + len);
+    put16(&udphdr[6], 0);
+    memcpy(&udphdr[UDP_HLEN], data, len);
+
+    // UDP checksum over the pseudo header and the datagram
+    const u16_t *addr = (const u16_t *)&iphdr[12];
+    u32_t sum = (u16_t)~inet_chksum(udphdr, UDP_HLEN + len);
+    sum += addr[0] + addr[1] + addr[2] + addr[3];
+    sum += lwip_htons(IP_PROTO_UDP);
+    sum += lwip_htons(UDP_HLEN + len);
+    sum = FOLD_U32T(sum);
+    sum = FOLD_U32T(sum);
+    chksum = ~sum;
+    if (chksum == 0)
+    {
+        chksum = 0xFFFF;
+    }
+    memcpy(&udphdr[6], &chksum, 2);
+
+    enc28j60PacketSend(REPLY_HDR_LEN + len, frame);
+    fastpath_stats.replies++;
+    return ERR_OK;
+}
+
+// Turns the echo request around in place: addresses swapped, type changed
+// and its checksum adjusted the way lwIP's icmp_input() does
+static void ENC28J60_HOT(fastpath_echo)(struct netif *netif, u8_t *frame, u16_t ip_len)
+{
+    u8_t *iphdr = frame + ETH_HDR_LEN;
+    struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *)(iphdr + (iphdr[0] & 0x0F) * 4);
+    u8_t tmp[6];
+
+    memcpy(&frame[0], &frame[6], 6);
+    memcpy(&frame[6], netif->hwaddr, 6);
+    memcpy(tmp, &iphdr[12], 4);
+    memcpy(&iphdr[12], &iphdr[16], 4);
+    memcpy(&iphdr[16], tmp, 4);
+
+    ICMPH_TYPE_SET(iecho, ICMP_ER);
+    if (iecho->chksum > PP_HTONS(0xffffU - (ICMP_ECHO << 8)))
+    {
+        iecho->chksum = (u16_t)(iecho->chksum + PP_HTONS((u16_t)(ICMP_ECHO << 8)) + 1);
+    }
+    else
+    {
+        iecho->chksum = (u16_t)(iecho->chksum + PP_HTONS(ICMP_ECHO << 8));
+    }
+
+    iphdr[8] = ICMP_TTL;
+    memset(&iphdr[10], 0, 2);
+    u16_t chksum = inet_chksum(iphdr, (iphdr[0] & 0x0F) * 4);
+    memcpy(&iphdr[10], &chksum, 2);
+
+    // the request's Ethernet padding is left behind, the chip pads again
+    enc28j60PacketSend(ETH_HDR_LEN + ip_len, frame);
+    fastpath_stats.echo++;
+}
+
+bool ENC28J60_HOT(fastpath_input)(struct netif *netif, u8_t *frame, u16_t len)
+{
+    if (len < ETH_HDR_LEN + IP_HLEN || get16(&frame[12]) != ETHTYPE_IP)
+    {
+        return false;
+    }
+
+    // only unicast to this netif, broadcasts and anything else are lwIP's
+    u8_t *iphdr = frame + ETH_HDR_LEN;
+    if (ip4_addr_isany_val(*netif_ip4_addr(netif)) ||
+        memcmp(&iphdr[16], netif_ip4_addr(netif), 4) != 0)
+    {
+        return false;
+    }
+
+    u16_t hlen = (iphdr[0] & 0x0F) * 4;
+    u16_t ip_len = get16(&iphdr[2]);
+    u8_t *data = iphdr + hlen;
+    u16_t data_len = ip_len - hlen;
+
+    if (iphdr[9] == IP_PROTO_ICMP)
+    {
+        if (!echo_enabled || data_len < sizeof(struct icmp_echo_hdr) || data[0] != ICMP_ECHO)
+        {
+            return false;
+        }
+        fastpath_echo(netif, frame, ip_len);
+        return true;
+    }
+
+    if (iphdr[9] != IP_PROTO_UDP || data_len < UDP_HLEN || get16(&data[4]) != data_len)
+    {
+        return false;
+    }
+    u16_t port = get16(&data[2]);
+    int i = udp_port_find(port);
+    if (i < 0)
+    {
+        return false;
+    }
+    ip4_addr_t src;
+    memcpy(&src, &iphdr[12], 4);
+    current.netif = netif;
+    current.frame = frame;
+    current.port = port;
+    udp_ports[i].recv(udp_ports[i].arg, data + UDP_HLEN, data_len - UDP_HLEN, &src, get16(&data[0]));
+    current.frame = NULL;
+    fastpath_stats.udp++;
+    return true;
+}
+
+void fastpath_report(void)
+{
+    if (!fastpath_active())
+    {
+        return;
+    }
+    printf("fastpath: %lu udp, %lu echo, %lu replies, %lu replies too long\n",
+           fastpath_stats.udp, fastpath_stats.echo, fastpath_stats.replies, fastpath_stats.reply_errors);
+}
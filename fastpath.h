@@ -0,0 +1,42 @@
+#ifndef FASTPATH_H
+#define FASTPATH_H
+
+#include "lwip/netif.h"
+#include "lwip/ip4_addr.h"
+
+// Receive fast path for small frames: UDP datagrams to registered ports and
+// ICMP echo requests addressed to the netif are handled straight from the
+// frame the driver read, without pbufs or the lwIP input chain.
+// Replies are built in a static frame and handed to enc28j60PacketSend().
+// Frames that are not claimed go on to lwIP unchanged.
+
+// largest frame the fast path looks at, bigger ones always go to lwIP
+#define FASTPATH_MAX_FRAME 256
+#define FASTPATH_UDP_PORTS 4
+
+// Called with the UDP payload, which points into the driver's receive buffer
+// and is only valid during the call
+typedef void (*fastpath_udp_fn)(void *arg, const u8_t *data, u16_t len, const ip4_addr_t *addr, u16_t port);
+
+// Datagrams the fast path takes never reach lwIP pcbs bound to the port.
+// Ones it passes over still do: longer than FASTPATH_MAX_FRAME, not unicast
+// to the netif, or with a bad length or checksum.
+err_t fastpath_udp_register(u16_t port, fastpath_udp_fn recv, void *arg);
+void fastpath_udp_unregister(u16_t port);
+void fastpath_echo_enable(bool enable);
+// Sends a datagram back to the sender of the one being handled, only valid
+// from inside a fastpath_udp_fn
+err_t fastpath_reply(const void *data, u16_t len);
+
+// true while anything is registered, frames are only read into the fast
+// path buffer then
+bool fastpath_active(void);
+// Cheap look at the Ethernet type, IP protocol and UDP port or ICMP type:
+// could fastpath_input() take this frame? Nothing is checksummed.
+bool fastpath_match(const u8_t *frame, u16_t len);
+// Takes a received frame with verified IP and transport checksums, returns
+// true if it was handled
+bool fastpath_input(struct netif *netif, u8_t *frame, u16_t len);
+void fastpath_report(void);
+
+#endif
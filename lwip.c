@@ -5,12 +5,21 @@
 #include "lwip/stats.h"
 #include "lwip/dhcp.h"
 #include "lwip/timeouts.h"
+#include "lwip/memp.h"
+#include "lwip/udp.h"
+#include "lwip/inet_chksum.h"
 #include "netif/etharp.h"
 #include <string.h>
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "hardware/spi.h"
 #include "enc28j60.h"
+#include "stream.h"
+#include "fastpath.h"
+
+#ifdef CHKSUM_BENCH
+void chksum_bench(void);
+#endif
 
 // SPI Defines
 // We are going to use SPI 0, and allocate it to the following GPIO pins
@@ -20,23 +29,229 @@
 #define PIN_CS 17
 #define PIN_SCK 18
 #define PIN_MOSI 19
+// The ENC28J60 INT output (active low) is optional. With it wired the main
+// loop sleeps until a frame arrives. Without it the chip is polled every
+// RX_POLL_MS, each poll costing a wake-up and an EPKTCNT read over SPI: a
+// shorter interval answers sooner but keeps the CPU busier when idle.
+// #define PIN_INT 20
+
+#ifdef PIN_INT
+#define RX_POLL_MS 50 // PKTIF is not fully reliable, see Rev. B4 Silicon Errata point 6
+#else
+#define RX_POLL_MS 10
+#endif
 
 // based on example from: https://www.nongnu.org/lwip/2_0_x/group__lwip__nosys.html
 #define ETHERNET_MTU 1500
+#define ETHERNET_FRAME_LEN (ETHERNET_MTU + ETH_HDR_LEN)
 
 uint8_t mac[6] = {0xAA, 0x6F, 0x77, 0x47, 0x75, 0x8C};
 
-static err_t netif_output(struct netif *netif, struct pbuf *p)
+// Receive flow control: PAUSE the link partner once the chip's receive ring
+// fills past FC_RING_HIGH bytes or lwIP's PBUF_POOL drops to FC_POOL_LOW free
+// pbufs, and release it once both are back below FC_RING_LOW / above FC_POOL_HIGH.
+#define RX_RING_SIZE (RXSTOP_INIT - RXSTART_INIT)
+#define FC_RING_HIGH (RX_RING_SIZE * 3 / 4)
+#define FC_RING_LOW (RX_RING_SIZE / 4)
+#define FC_POOL_LOW 2
+#define FC_POOL_HIGH 4
+// a pause quantum is 512 bit times, 51.2us at 10Mb/s
+#define PAUSE_QUANTUM_NS 51200
+
+#define FC_INTERVAL_MS 20
+
+// how often to check for the TX buffer to free up while frames wait in the
+// chip's transmit store, a full frame takes 1.2ms on the wire
+#define TX_POLL_US 200
+
+#define STATS_INTERVAL_MS 10000
+
+static uint8_t mac_send_buffer[ETHERNET_FRAME_LEN];
+static struct pbuf *rx_pbuf;
+// small frames land here while the fast path has registrations
+static uint8_t fast_rx_buf[ETH_PAD_SIZE + FASTPATH_MAX_FRAME] __attribute__((aligned(4)));
+
+static struct
+{
+    uint32_t rx_frames;
+    uint32_t rx_drains;
+    uint32_t rx_dropped;
+    uint32_t rx_input_us;
+    uint32_t rx_fast;
+    uint32_t rx_fast_us;
+    uint32_t rx_csum_offload;
+    uint32_t rx_overflows;
+    uint32_t pause_on;
+    uint32_t pause_off;
+    uint32_t timer_runs;
+    uint32_t timer_late_us;
+    uint32_t timer_late_max_us;
+} drv_stats;
+
+// Time from the driver asking for a buffer to the frame having been
+// handled, per stats interval
+static struct
+{
+    uint32_t frames;
+    uint32_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+} rx_latency;
+static uint32_t rx_start;
+
+static bool flow_paused;
+
+static void ENC28J60_HOT(rx_latency_add)(uint32_t us)
+{
+    if (rx_latency.frames == 0 || us < rx_latency.min_us)
+    {
+        rx_latency.min_us = us;
+    }
+    if (us > rx_latency.max_us)
+    {
+        rx_latency.max_us = us;
+    }
+    rx_latency.sum_us += us;
+    rx_latency.frames++;
+}
+
+static uint16_t pbuf_pool_free(void)
+{
+    return MEMP_STATS_GET(avail, MEMP_PBUF_POOL) - MEMP_STATS_GET(used, MEMP_PBUF_POOL);
+}
+
+static void flow_control_update(void)
+{
+    uint16_t ring_used = RX_RING_SIZE - enc28j60RxFreeSpace();
+    uint16_t pool_free = pbuf_pool_free();
+
+    if (enc28j60RxOverflow())
+    {
+        drv_stats.rx_overflows++;
+    }
+
+    if (!flow_paused && (ring_used >= FC_RING_HIGH || pool_free <= FC_POOL_LOW))
+    {
+        // ask for long enough to drain what is buffered over SPI
+        uint64_t drain_ns = (uint64_t)ring_used * 8 * 1000000000 / spi_get_baudrate(SPI_PORT);
+        uint32_t quanta = drain_ns / PAUSE_QUANTUM_NS + 1;
+        enc28j60FlowControl(1, quanta > 0xFFFF ? 0xFFFF : quanta);
+        flow_paused = true;
+        drv_stats.pause_on++;
+    }
+    else if (flow_paused && ring_used <= FC_RING_LOW && pool_free >= FC_POOL_HIGH)
+    {
+        enc28j60FlowControl(0, 0);
+        flow_paused = false;
+        drv_stats.pause_off++;
+    }
+}
+
+static void stats_report(void)
+{
+    static uint32_t last_us, last_fast, last_lwip;
+    uint32_t now = time_us_32();
+    uint32_t elapsed_ms = (now - last_us) / 1000;
+    uint32_t rx_lwip = drv_stats.rx_frames - drv_stats.rx_fast;
+
+    printf("enc28j60: rx %lu frames in %lu drains, %lu dropped, %lu us/frame in lwIP, %lu overflows, pause %lu/%lu, ring free %u, pool free %u\n",
+           drv_stats.rx_frames, drv_stats.rx_drains, drv_stats.rx_dropped,
+           rx_lwip ? drv_stats.rx_input_us / rx_lwip : 0,
+           drv_stats.rx_overflows, drv_stats.pause_on, drv_stats.pause_off,
+           enc28j60RxFreeSpace(), pbuf_pool_free());
+    printf("enc28j60: %lu frames with checksums verified by the driver\n", drv_stats.rx_csum_offload);
+    if (elapsed_ms)
+    {
+        printf("enc28j60: fast path %lu frames at %lu pps, %lu us/frame; lwIP %lu frames at %lu pps, %lu us/frame\n",
+               drv_stats.rx_fast, (drv_stats.rx_fast - last_fast) * 1000 / elapsed_ms,
+               drv_stats.rx_fast ? drv_stats.rx_fast_us / drv_stats.rx_fast : 0,
+               rx_lwip, (rx_lwip - last_lwip) * 1000 / elapsed_ms,
+               rx_lwip ? drv_stats.rx_input_us / rx_lwip : 0);
+    }
+    if (rx_latency.frames)
+    {
+        printf("enc28j60: frame latency %lu us mean, %lu min, %lu max, %lu jitter over %lu frames\n",
+               rx_latency.sum_us / rx_latency.frames, rx_latency.min_us, rx_latency.max_us,
+               rx_latency.max_us - rx_latency.min_us, rx_latency.frames);
+        memset(&rx_latency, 0, sizeof(rx_latency));
+    }
+    last_us = now;
+    last_fast = drv_stats.rx_fast;
+    last_lwip = rx_lwip;
+    printf("enc28j60: lwIP timers %lu runs, woken %lu us after the ms-rounded due time on average, %lu us worst\n",
+           drv_stats.timer_runs, drv_stats.timer_runs ? drv_stats.timer_late_us / drv_stats.timer_runs : 0,
+           drv_stats.timer_late_max_us);
+
+#if ENC28J60_TXSTORE_SIZE
+    struct enc28j60TxStoreStats tx_store;
+    enc28j60GetTxStoreStats(&tx_store);
+    printf("enc28j60: tx store %lu hits, %lu misses, %lu replayed, %u bytes used, %u peak of %u\n",
+           tx_store.hits, tx_store.misses, tx_store.replays, tx_store.used, tx_store.peak,
+           TXSTORE_STOP_INIT - TXSTORE_START_INIT + 1);
+#endif
+    stream_report();
+    fastpath_report();
+}
+
+// Application task wheel: periodic jobs scheduled next to lwIP's timers
+struct app_task
+{
+    uint32_t interval_ms;
+    void (*run)(void);
+    absolute_time_t due;
+};
+
+static struct app_task app_tasks[] = {
+    {FC_INTERVAL_MS, flow_control_update},
+    {STATS_INTERVAL_MS, stats_report},
+    {STREAM_REFRESH_MS, stream_refresh},
+};
+
+// Runs the tasks that are due, returns when the next one is
+static absolute_time_t app_tasks_run(absolute_time_t now)
+{
+    absolute_time_t next = at_the_end_of_time;
+    for (uint i = 0; i < count_of(app_tasks); i++)
+    {
+        struct app_task *task = &app_tasks[i];
+        if (absolute_time_diff_us(task->due, now) >= 0)
+        {
+            task->run();
+            task->due = delayed_by_ms(now, task->interval_ms);
+        }
+        next = absolute_time_min(next, task->due);
+    }
+    return next;
+}
+
+#ifdef PIN_INT
+static void enc28j60_irq(uint gpio, uint32_t events)
+{
+    // nothing to do, taking the interrupt wakes the main loop from __wfe()
+}
+#endif
+
+static err_t ENC28J60_HOT(netif_output)(struct netif *netif, struct pbuf *p)
 {
     LINK_STATS_INC(link.xmit);
 
     // lock_interrupts();
-    // pbuf_copy_partial(p, mac_send_buffer, p->tot_len, 0);
     /* Start MAC transmit here */
 
-    printf("enc28j60: Sending packet of len %d\n", p->len);
-    enc28j60PacketSend(p->len, (uint8_t *)p->payload);
-    // pbuf_free(p);
+    // the frame starts after the ETH_PAD_SIZE bytes lwIP keeps in front of
+    // the Ethernet header; chained pbufs are flattened first
+    uint16_t len = p->tot_len - ETH_PAD_SIZE;
+    uint8_t *frame = (uint8_t *)p->payload + ETH_PAD_SIZE;
+    if (p->next != NULL)
+    {
+        pbuf_copy_partial(p, mac_send_buffer, len, ETH_PAD_SIZE);
+        frame = mac_send_buffer;
+    }
+
+#if FRAME_DEBUG
+    printf("enc28j60: Sending packet of len %d\n", len);
+#endif
+    enc28j60PacketSend(len, frame);
 
     // error sending
     if (enc28j60Read(ESTAT) & ESTAT_TXABRT)
@@ -55,9 +270,177 @@ static err_t netif_output(struct netif *netif, struct pbuf *p)
     return ERR_OK;
 }
 
+// lwIP checks skipped for frames rx_checksum_ok() has verified
+#define RX_CHECKSUM_CHECKS (NETIF_CHECKSUM_CHECK_IP | NETIF_CHECKSUM_CHECK_UDP | \
+                            NETIF_CHECKSUM_CHECK_TCP | NETIF_CHECKSUM_CHECK_ICMP)
+
+// Verifies the IPv4 header and the UDP/TCP/ICMP checksum of a received frame
+// using frame_sum, the sum the DMA sniffer took over the whole frame while it
+// was read, so the payload is not read again. The Ethernet and IP headers and
+// any Ethernet padding are taken back out of it (adding ~x subtracts x in
+// ones' complement) and the pseudo header is added in.
+// Fragments are left to lwIP, their checksum covers the reassembled datagram.
+static bool ENC28J60_HOT(rx_checksum_ok)(const uint8_t *frame, uint16_t len, uint16_t frame_sum)
+{
+    const uint8_t *iphdr = frame + ETH_HDR_LEN;
+
+    if (len < ETH_HDR_LEN + IP_HLEN || frame[12] != 0x08 || frame[13] != 0x00)
+    {
+        return false;
+    }
+    u16_t hlen = (iphdr[0] & 0x0F) * 4;
+    u16_t ip_len = get16(&iphdr[2]);
+    if ((iphdr[0] >> 4) != 4 || hlen < IP_HLEN || ip_len < hlen || ETH_HDR_LEN + ip_len > len)
+    {
+        return false;
+    }
+    // more fragments flag or fragment offset
+    if ((iphdr[6] & 0x3F) || iphdr[7])
+    {
+        return false;
+    }
+    if (inet_chksum(iphdr, hlen) != 0)
+    {
+        return false;
+    }
+
+    u8_t proto = iphdr[9];
+    u16_t data_len = ip_len - hlen;
+    const u8_t *data = iphdr + hlen;
+    if (proto == IP_PROTO_UDP && data_len >= UDP_HLEN && data[6] == 0 && data[7] == 0)
+    {
+        // sent without checksum
+        return true;
+    }
+    if (proto != IP_PROTO_UDP && proto != IP_PROTO_TCP && proto != IP_PROTO_ICMP)
+    {
+        // lwIP has no other checksum to check
+        return true;
+    }
+
+    u32_t sum = frame_sum + inet_chksum(frame, ETH_HDR_LEN + hlen);
+    u16_t end = ETH_HDR_LEN + ip_len;
+    if (end < len)
+    {
+        u16_t pad = inet_chksum(frame + end, len - end);
+        sum += (end & 1) ? SWAP_BYTES_IN_WORD(pad) : pad;
+    }
+    if (proto != IP_PROTO_ICMP)
+    {
+        const u16_t *addr = (const u16_t *)&iphdr[12];
+        sum += addr[0] + addr[1] + addr[2] + addr[3];
+        sum += proto << 8;
+        sum += lwip_htons(data_len);
+    }
+    sum = FOLD_U32T(sum);
+    sum = FOLD_U32T(sum);
+    return sum == 0xFFFF;
+}
+
+// Frames are read or copied whole into the first pool pbuf, a smaller
+// PBUF_POOL_BUFSIZE (e.g. from a lower TCP_MSS) would get a chain back and
+// full-size frames would overrun it
+#if PBUF_POOL_BUFSIZE < ETHERNET_FRAME_LEN + ETH_PAD_SIZE
+#error "PBUF_POOL_BUFSIZE must hold ETHERNET_FRAME_LEN + ETH_PAD_SIZE"
+#endif
+
+// Receive straight into a pool pbuf, ETH_PAD_SIZE bytes in so the IP header
+// that follows the 14 byte Ethernet header is word aligned.
+// PBUF_POOL_BUFSIZE covers a full frame (checked above), so the pbuf is
+// never chained.
+// Frames small enough for the fast path are read into fast_rx_buf instead
+// and only copied to a pbuf if the fast path does not take them.
+static uint8_t *ENC28J60_HOT(rx_buffer)(uint16_t len, void *arg)
+{
+    rx_start = time_us_32();
+    if (len <= FASTPATH_MAX_FRAME && fastpath_active())
+    {
+        rx_pbuf = NULL;
+        return fast_rx_buf + ETH_PAD_SIZE;
+    }
+    rx_pbuf = pbuf_alloc(PBUF_RAW, len + ETH_PAD_SIZE, PBUF_POOL);
+    if (rx_pbuf == NULL)
+    {
+        drv_stats.rx_dropped++;
+        return NULL;
+    }
+    return (uint8_t *)rx_pbuf->payload + ETH_PAD_SIZE;
+}
+
+static void ENC28J60_HOT(rx_done)(uint8_t *packet, uint16_t len, void *arg)
+{
+    struct netif *netif = arg;
+    struct pbuf *p = rx_pbuf;
+
+    drv_stats.rx_frames++;
+    LINK_STATS_INC(link.recv);
+
+    uint16_t sum;
+    bool have_sum = enc28j60RxChecksum(&sum);
+    bool checked = false;
+    bool verified = false;
+    if (p == NULL)
+    {
+        // the fast path only takes frames with good checksums, without the
+        // sniffer's sum a frame it could take is small enough to sum here
+        uint32_t start = time_us_32();
+        if (fastpath_match(packet, len))
+        {
+            if (!have_sum)
+            {
+                sum = ~inet_chksum(packet, len);
+            }
+            verified = rx_checksum_ok(packet, len, sum);
+            checked = true;
+            if (verified && fastpath_input(netif, packet, len))
+            {
+                drv_stats.rx_fast++;
+                drv_stats.rx_fast_us += time_us_32() - start;
+                rx_latency_add(time_us_32() - rx_start);
+                return;
+            }
+        }
+        p = pbuf_alloc(PBUF_RAW, len + ETH_PAD_SIZE, PBUF_POOL);
+        if (p == NULL)
+        {
+            drv_stats.rx_dropped++;
+            return;
+        }
+        memcpy((uint8_t *)p->payload + ETH_PAD_SIZE, packet, len);
+    }
+    if (!checked)
+    {
+        verified = have_sum && rx_checksum_ok(packet, len, sum);
+    }
+
+#if FRAME_DEBUG
+    printf("enc: Received packet of length = %d\n", len);
+#endif
+
+    // frames whose checksums verify go through lwIP without its own
+    // checksum checks, anything else gets all of them. The checks are back on
+    // as soon as input returns, nothing else reaches lwIP without them.
+    if (verified)
+    {
+        drv_stats.rx_csum_offload++;
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~RX_CHECKSUM_CHECKS);
+    }
+
+    rx_pbuf = NULL;
+    uint32_t start = time_us_32();
+    if (netif->input(p, netif) != ERR_OK)
+    {
+        pbuf_free(p);
+    }
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL);
+    drv_stats.rx_input_us += time_us_32() - start;
+    rx_latency_add(time_us_32() - rx_start);
+}
+
 static void netif_status_callback(struct netif *netif)
 {
     printf("netif status changed %s\n", ip4addr_ntoa(netif_ip4_addr(netif)));
+    stream_refresh();
 }
 
 static err_t netif_initialize(struct netif *netif)
@@ -96,6 +479,10 @@ void main(void)
         sleep_ms(1000);
     }
 
+#ifdef CHKSUM_BENCH
+    chksum_bench();
+#endif
+
     ip_addr_t addr, mask, static_ip;
     IP4_ADDR(&static_ip, 192, 168, 1, 111);
     IP4_ADDR(&mask, 255, 255, 255, 0);
@@ -117,41 +504,67 @@ void main(void)
     // dhcp_start(&netif);
 
     enc28j60Init(mac);
-    uint8_t *eth_pkt = malloc(ETHERNET_MTU);
-    struct pbuf *p = NULL;
 
     netif_set_link_up(&netif);
 
+    // answer pings without going through lwIP, see fastpath.h
+    // fastpath_echo_enable(true);
+
+#ifdef PIN_INT
+    gpio_init(PIN_INT);
+    gpio_pull_up(PIN_INT);
+    gpio_set_irq_enabled_with_callback(PIN_INT, GPIO_IRQ_EDGE_FALL, true, enc28j60_irq);
+#endif
+
+    absolute_time_t lwip_due = nil_time;
     while (1)
     {
-        uint16_t packet_len = enc28j60PacketReceive(ETHERNET_MTU, (uint8_t *)eth_pkt);
-        if (packet_len)
-        {
-            printf("enc: Received packet of length = %d\n", packet_len);
-            p = pbuf_alloc(PBUF_RAW, packet_len, PBUF_POOL);
-            pbuf_take(p, eth_pkt, packet_len);
-            free(eth_pkt);
-            eth_pkt = malloc(ETHERNET_MTU);
-        }
-        else
+        // take every frame the chip holds in one pass
+        uint8_t frames = enc28j60PacketReceiveAll(ETHERNET_FRAME_LEN, rx_buffer, rx_done, &netif);
+        if (frames)
         {
-            // printf("enc: no packet received\n");
+            drv_stats.rx_drains++;
+            flow_control_update();
         }
 
-        if (packet_len && p != NULL)
+        /* Cyclic lwIP timers check */
+        // lateness is measured against lwip_due, the wake-up time derived
+        // from sys_timeouts_sleeptime() in whole ms, so it shows how late the
+        // loop wakes rather than how late lwIP's own timers fire
+        absolute_time_t now = get_absolute_time();
+        if (!is_nil_time(lwip_due) && absolute_time_diff_us(lwip_due, now) >= 0)
         {
-            LINK_STATS_INC(link.recv);
-
-            if (netif.input(p, &netif) != ERR_OK)
+            uint32_t late = absolute_time_diff_us(lwip_due, now);
+            drv_stats.timer_runs++;
+            drv_stats.timer_late_us += late;
+            if (late > drv_stats.timer_late_max_us)
             {
-                pbuf_free(p);
+                drv_stats.timer_late_max_us = late;
             }
         }
-
-        /* Cyclic lwIP timers check */
         sys_check_timeouts();
 
         /* your application goes here */
-        sleep_ms(100);
+        absolute_time_t wake = app_tasks_run(now);
+
+        // send frames parked in the chip's transmit store
+        if (enc28j60TxPoll())
+        {
+            wake = absolute_time_min(wake, delayed_by_us(now, TX_POLL_US));
+        }
+
+        // sleep until the next lwIP timeout, application task or receive
+        // poll, or until the chip raises INT
+        u32_t lwip_sleep_ms = sys_timeouts_sleeptime();
+        lwip_due = lwip_sleep_ms == SYS_TIMEOUTS_SLEEPTIME_INFINITE ? nil_time : make_timeout_time_ms(lwip_sleep_ms);
+        if (!is_nil_time(lwip_due))
+        {
+            wake = absolute_time_min(wake, lwip_due);
+        }
+        wake = absolute_time_min(wake, delayed_by_ms(now, RX_POLL_MS));
+        if (frames == 0)
+        {
+            best_effort_wfe_or_timeout(wake);
+        }
     }
 }
\ No newline at end of file
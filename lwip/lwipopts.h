@@ -47,9 +47,26 @@
 // http://lwip.100.n7.nabble.com/Build-issue-if-LWIP-DHCP-is-set-to-0-td33280.html
 #define LWIP_DHCP_DOES_ACD_CHECK        0
 
-#define ETH_PAD_SIZE                    0
+// pad the 14 byte Ethernet header so IP headers land word aligned
+#define ETH_PAD_SIZE                    2
 #define LWIP_IP_ACCEPT_UDP_PORT(p)      ((p) == PP_NTOHS(67))
 
+// Cortex-M0+ checksum routines from chksum.c/chksum.S, run from SRAM.
+// LWIP_CHKSUM_COPY lets TCP sum data as it copies it into segments.
+#define LWIP_CHKSUM                     pico_chksum
+#define LWIP_CHECKSUM_ON_COPY           1
+#define LWIP_CHKSUM_COPY(dst, src, len) pico_chksum_copy(dst, src, len)
+
+#include <stdint.h>
+uint16_t pico_chksum(const void *dataptr, int len);
+uint16_t pico_chksum_copy(void *dst, const void *src, uint16_t len);
+
+// received frames have their checksums verified by the driver where it can
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+
+// PBUF_POOL usage feeds the driver's receive flow control
+#define MEMP_STATS                      1
+
 #define LWIP_NETIF_LINK_CALLBACK        1
 #define LWIP_NETIF_STATUS_CALLBACK      1
 
@@ -60,7 +77,14 @@
 #define LWIP_HTTPD_SSI                  0
 #define LWIP_HTTPD_SSI_INCLUDE_TAG      0
 
-#if 1
+// Per-packet debug output: lwIP's debug messages and a line for every frame
+// in lwip.c. Printing over USB dominates per-frame timing and skews the
+// latency stats, so it is off unless FRAME_DEBUG is defined as 1.
+#ifndef FRAME_DEBUG
+#define FRAME_DEBUG 0
+#endif
+
+#if FRAME_DEBUG
 #define LWIP_DEBUG 1
 #define TCP_DEBUG                       LWIP_DBG_ON
 #define ETHARP_DEBUG                    LWIP_DBG_ON
@@ -0,0 +1,191 @@
+#include "lwip/udp.h"
+#include "lwip/ip4.h"
+#include "lwip/inet_chksum.h"
+#include "netif/etharp.h"
+#include <string.h>
+#include <stdio.h>
+#include "enc28j60.h"
+#include "stream.h"
+
+#define STREAM_HDR_LEN (ETH_HDR_LEN + IP_HLEN + UDP_HLEN)
+
+// template offsets of the fields that change per datagram:
+// IP total length, ID and checksum (with flags, TTL and protocol in between)
+#define IP_FIELDS_OFS (ETH_HDR_LEN + 2)
+#define IP_FIELDS_LEN 10
+#define UDP_LEN_OFS (ETH_HDR_LEN + IP_HLEN + 4)
+
+static struct
+{
+    struct netif *netif;
+    struct udp_pcb *pcb;
+    ip_addr_t dst;
+    u16_t local_port;
+    u16_t remote_port;
+    // the template in chip memory is current and can be sent from
+    bool valid;
+    u16_t ip_id;
+    // sum of the IP header words that do not change per datagram
+    u32_t ip_sum;
+    // payload length the UDP length field in chip memory is set for
+    u16_t udp_len;
+    u8_t tpl[STREAM_HDR_LEN];
+} stream;
+
+static struct
+{
+    u32_t fast;
+    u32_t fallback;
+    u32_t refreshes;
+} stream_stats;
+
+void stream_refresh(void)
+{
+    struct netif *netif;
+    const ip4_addr_t *dst;
+    const ip4_addr_t *next_hop;
+    const ip4_addr_t *unused;
+    struct eth_addr *eth;
+    u8_t tpl[STREAM_HDR_LEN];
+
+    // without a stream frame region everything goes through lwIP
+    if (stream.pcb == NULL || STREAM_MAX_FRAMELEN < STREAM_HDR_LEN)
+    {
+        return;
+    }
+
+    // only frames leaving through the ENC28J60 can use the template
+    dst = ip_2_ip4(&stream.dst);
+    netif = ip4_route(dst);
+    if (netif != stream.netif)
+    {
+        stream.valid = false;
+        return;
+    }
+    next_hop = dst;
+    if (!ip4_addr_netcmp(dst, netif_ip4_addr(netif), netif_ip4_netmask(netif)))
+    {
+        next_hop = netif_ip4_gw(netif);
+    }
+    if (etharp_find_addr(netif, next_hop, &eth, &unused) < 0)
+    {
+        // lwIP carries the datagrams until the next hop has answered
+        etharp_request(netif, next_hop);
+        stream.valid = false;
+        return;
+    }
+
+    memset(tpl, 0, sizeof(tpl));
+    // Ethernet header
+    memcpy(&tpl[0], eth->addr, 6);
+    memcpy(&tpl[6], netif->hwaddr, 6);
+    put16(&tpl[12], ETHTYPE_IP);
+    // IP header, total length, ID and checksum are filled in per datagram
+    u8_t *iphdr = &tpl[ETH_HDR_LEN];
+    iphdr[0] = 0x45;
+    put16(&iphdr[6], 0x4000); // don't fragment
+    iphdr[8] = UDP_TTL;
+    iphdr[9] = IP_PROTO_UDP;
+    memcpy(&iphdr[12], netif_ip4_addr(netif), 4);
+    memcpy(&iphdr[16], dst, 4);
+    // UDP header, length is filled in per datagram, no checksum
+    u8_t *udphdr = &iphdr[IP_HLEN];
+    put16(&udphdr[0], stream.local_port);
+    put16(&udphdr[2], stream.remote_port);
+
+    if (!stream.valid || memcmp(tpl, stream.tpl, sizeof(tpl)) != 0)
+    {
+        memcpy(stream.tpl, tpl, sizeof(tpl));
+        enc28j60StreamWrite(0, sizeof(tpl), stream.tpl);
+        stream.ip_sum = (u16_t)~inet_chksum(iphdr, IP_HLEN);
+        // no payload length matches, the first datagram writes the UDP length
+        stream.udp_len = 0xFFFF;
+        stream.valid = true;
+        stream_stats.refreshes++;
+    }
+}
+
+err_t stream_open(struct netif *netif, const ip4_addr_t *dst, u16_t local_port, u16_t remote_port)
+{
+    err_t err;
+
+    stream.pcb = udp_new();
+    if (stream.pcb == NULL)
+    {
+        return ERR_MEM;
+    }
+    err = udp_bind(stream.pcb, IP_ADDR_ANY, local_port);
+    if (err != ERR_OK)
+    {
+        udp_remove(stream.pcb);
+        stream.pcb = NULL;
+        return err;
+    }
+    stream.netif = netif;
+    ip_addr_copy_from_ip4(stream.dst, *dst);
+    stream.local_port = local_port;
+    stream.remote_port = remote_port;
+    stream.valid = false;
+    stream_refresh();
+    return ERR_OK;
+}
+
+err_t ENC28J60_HOT(stream_send)(const void *data, u16_t len)
+{
+    if (stream.pcb == NULL)
+    {
+        return ERR_VAL;
+    }
+
+    if (!stream.valid || STREAM_HDR_LEN + len > STREAM_MAX_FRAMELEN)
+    {
+        struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+        if (p == NULL)
+        {
+            return ERR_MEM;
+        }
+        memcpy(p->payload, data, len);
+        err_t err = udp_sendto(stream.pcb, p, &stream.dst, stream.remote_port);
+        pbuf_free(p);
+        stream_stats.fallback++;
+        return err;
+    }
+
+    // IP total length and ID, checksum updated from the constant part
+    u8_t fields[IP_FIELDS_LEN];
+    u16_t ip_len = lwip_htons(IP_HLEN + UDP_HLEN + len);
+    u16_t ip_id = lwip_htons(stream.ip_id++);
+    u32_t sum = stream.ip_sum + ip_len + ip_id;
+    sum = FOLD_U32T(sum);
+    sum = FOLD_U32T(sum);
+    u16_t chksum = ~sum;
+    memcpy(fields, &stream.tpl[IP_FIELDS_OFS], sizeof(fields));
+    memcpy(&fields[0], &ip_len, 2);
+    memcpy(&fields[2], &ip_id, 2);
+    memcpy(&fields[8], &chksum, 2);
+    enc28j60StreamWrite(IP_FIELDS_OFS, sizeof(fields), fields);
+
+    // the UDP length only needs rewriting when the payload size changes
+    if (len != stream.udp_len)
+    {
+        u8_t udp_len[2];
+        put16(udp_len, UDP_HLEN + len);
+        enc28j60StreamWrite(UDP_LEN_OFS, sizeof(udp_len), udp_len);
+        stream.udp_len = len;
+    }
+
+    enc28j60StreamWrite(STREAM_HDR_LEN, len, (u8_t *)data);
+    enc28j60StreamSend(STREAM_HDR_LEN + len);
+    stream_stats.fast++;
+    return ERR_OK;
+}
+
+void stream_report(void)
+{
+    if (stream.pcb == NULL)
+    {
+        return;
+    }
+    printf("stream: %lu from template, %lu through lwIP, %lu template refreshes\n",
+           stream_stats.fast, stream_stats.fallback, stream_stats.refreshes);
+}
@@ -0,0 +1,22 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "lwip/netif.h"
+#include "lwip/ip4_addr.h"
+
+// Fixed-destination UDP stream sent from a header template pinned in the
+// ENC28J60's buffer memory, see enc28j60StreamWrite(). Only the payload and
+// the IP/UDP length, IP ID and IP checksum go over SPI per datagram.
+// Datagrams are sent through lwIP instead while the next hop's MAC address
+// is unknown or the payload does not fit STREAM_MAX_FRAMELEN, and always
+// unless the driver is built with ENC28J60_STREAM_SIZE.
+
+#define STREAM_REFRESH_MS 1000
+
+err_t stream_open(struct netif *netif, const ip4_addr_t *dst, u16_t local_port, u16_t remote_port);
+err_t stream_send(const void *data, u16_t len);
+// Rebuilds the template after routing or ARP changes, run it every STREAM_REFRESH_MS
+void stream_refresh(void);
+void stream_report(void);
+
+#endif
@@ -0,0 +1,10 @@
+// Host stand-in for lwIP's arch.h, just enough for chksum.c, see chksum_fuzz.c
+#ifndef HOST_LWIP_ARCH_H
+#define HOST_LWIP_ARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint16_t u16_t;
+
+#endif
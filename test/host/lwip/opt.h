@@ -0,0 +1,7 @@
+// Host stand-in for lwIP's opt.h, just enough for chksum.c, see chksum_fuzz.c
+#ifndef HOST_LWIP_OPT_H
+#define HOST_LWIP_OPT_H
+
+#include "lwip/arch.h"
+
+#endif
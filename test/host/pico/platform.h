@@ -0,0 +1,7 @@
+// Host stand-in for the Pico SDK's platform.h, see chksum_fuzz.c
+#ifndef HOST_PICO_PLATFORM_H
+#define HOST_PICO_PLATFORM_H
+
+#define __not_in_flash_func(func) func
+
+#endif